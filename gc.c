@@ -1,12 +1,77 @@
+#define _GNU_SOURCE
 #include "gc.h"
+#ifdef __GNUC__
+#include <unwind.h>
+#define GC_HAVE_UNWIND
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define GC_HAVE_MMAP
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#define GC_HAVE_REGIONS
+#endif
 #define GC_PRIMES_COUNT 24
+// note the stack address inside a public call while profiling, the profiler skips the frames under it
+#define GC_PROFILE_ENTRY(gc) char prof_entry; if ((gc)->profiling) (gc)->prof_entry = (uintptr_t)&prof_entry
+#define GC_HEAP_MALLOC (-1)                 // gc_ptr_t.node of an allocation from malloc
+#define GC_HEAP_IMAGE(i) (-2 - (int)(i))    // gc_ptr_t.node of an allocation inside heap image i
+#define GC_IMAGE_INDEX(node) ((size_t)(-2 - (node))) // heap image of an allocation on node <= GC_HEAP_IMAGE(0)
+#define GC_REGION_SIZE ((size_t)2 << 20)    // size and alignment of a region, one huge page
+#define GC_CLASS_MIN ((size_t)16)           // block size of the smallest size class
+#define GC_CLASS_MAX (GC_CLASS_MIN << (GC_CLASSES_COUNT - 1)) // block size of the largest size class
+#define GC_PAGE_SHIFT 12                    // log2 of the page size of the blacklist
+#define GC_BLACKLIST_TRIES 8                // blacklisted blocks skipped by one allocation at most
+#define GC_HELD_MAX ((size_t)1 << 20)       // bytes of blacklisted blocks held at most
+#define GC_HELD_BLOCK_MAX ((size_t)1 << GC_PAGE_SHIFT) // larger blocks are never held
+#define GC_IMAGE_MAGIC "GCIMAGE1"           // first bytes of a heap image file
+#define GC_IMAGE_ALIGN ((uint64_t)1 << 16)  // alignment of the data in a heap image, any page size
+#define GC_IMAGE_NONE UINT64_MAX            // root index of a root outside the heap
+
+/* header of a heap image file, followed by
+ * objects_cnt gc_image_object_t, roots_cnt root indexes into the objects,
+ * relocs_cnt data offsets of pointer words, then the data at data_offset
+ * */
+typedef struct gc_image_header{
+    char magic[8];          // GC_IMAGE_MAGIC
+    uint64_t word_size;     // sizeof(void *) of the process writing the image
+    uint64_t objects_cnt;   // number of objects
+    uint64_t roots_cnt;     // number of roots
+    uint64_t relocs_cnt;    // number of pointer words
+    uint64_t data_offset;   // file offset of the data, aligned to GC_IMAGE_ALIGN
+    uint64_t data_size;     // bytes of the data
+}gc_image_header_t;
+
+typedef struct gc_image_object{
+    uint64_t offset;        // offset of the object in the data
+    uint64_t size;          // size of the object
+    uint64_t flags;         // flags of the object
+}gc_image_object_t;
 
 static void gc_mark_ptr(gc_t *gc, void *ptr);
 static size_t gc_hash(void *ptr);
 static size_t gc_offset(gc_t *gc, size_t i, size_t h);
 static void gc_adjust_slots(gc_t *gc);
 static gc_ptr_t *gc_get_item(gc_t *gc, void *ptr);
-static void gc_insert_item(gc_t *gc, void *ptr, size_t size, int flags, void (*dtor)(void *));
+static gc_ptr_t *gc_insert_item(gc_t *gc, void *ptr, size_t size, int flags, void (*dtor)(void *));
+static size_t gc_profile_sample(gc_t *gc, size_t size);
+static void *gc_alloc_item(gc_t *gc, size_t size, int flags, void (*dtor)(void *));
+static void *gc_calloc_item(gc_t *gc, size_t num, size_t size, int flags, void (*dtor)(void *));
+static void gc_profile_release(gc_t *gc, size_t site, size_t size);
+static void *gc_heap_alloc(gc_t *gc, size_t size, int zero, int *node);
+static size_t gc_size_class(size_t size);
+static void gc_heap_release(gc_t *gc, void *ptr, size_t size, int node);
+static void gc_blacklist_add(gc_t *gc, void *ptr);
+static int gc_blacklisted(gc_t *gc, void *ptr, size_t size);
+static void gc_blacklist_rotate(gc_t *gc);
+static void gc_blacklist_misses(gc_t *gc);
+static void gc_release_held(gc_t *gc, int all);
+static void gc_heap_unplace(gc_t *gc, void *ptr, size_t size, int node);
 
 static const size_t gc_primes[GC_PRIMES_COUNT] = {
     0, 1, 5, 11,
@@ -31,6 +96,49 @@ void gc_start(gc_t *gc, void *stk)
     gc->min_ptr = UINTPTR_MAX;
     gc->load_factor = 0.9;
     gc->sweep_factor = 0.5;
+    gc->profiling = 0;
+    gc->prof_rate = 0;
+    gc->prof_left = 0;
+    gc->prof_seed = 0;
+    gc->prof_entry = 0;
+    gc->sites = NULL;
+    gc->sites_cnt = 0;
+    gc->sites_cap = 0;
+    gc->sites_index = NULL;
+    gc->index_cnt = 0;
+    gc->precise = 0;
+    gc->roots = NULL;
+    gc->roots_cnt = 0;
+    gc->roots_cap = 0;
+    gc->scopes = NULL;
+    gc->scopes_cnt = 0;
+    gc->scopes_cap = 0;
+    gc->heap = 0;
+    memset(gc->nodes, 0, sizeof(gc->nodes));
+    gc->regions = NULL;
+    gc->regions_cap = 0;
+    memset(&gc->stats, 0, sizeof(gc_stats_t));
+    gc->images = NULL;
+    gc->images_cnt = 0;
+    gc->blacklisting = 0;
+    gc->chunks = NULL;
+    gc->chunks_cnt = 0;
+    gc->chunks_slots = 0;
+    gc->misses = NULL;
+    gc->misses_cnt = 0;
+    gc->misses_cap = 0;
+    gc->held = NULL;
+    gc->held_cnt = 0;
+    gc->held_cap = 0;
+}
+
+/* gc starts in precise roots mode
+ * only the local variables registered by gc_root_local are roots on the stack
+ * */
+void gc_start_precise(gc_t *gc)
+{
+    gc_start(gc, NULL);
+    gc->precise = 1;
 }
 
 /* sweep operation */
@@ -64,7 +172,7 @@ void gc_sweep(gc_t *gc)
         return;
     }
     size_t k = 0;
-    for (size_t i = 0; i < gc->slots_cnt; i++)
+    for (size_t i = 0; i < gc->slots_cnt;)
     {
         if (gc->items[i].hash == 0)
         {
@@ -83,6 +191,7 @@ void gc_sweep(gc_t *gc)
         }
 
         gc->frees[k++] = gc->items[i];
+        gc_profile_release(gc, gc->items[i].site, gc->items[i].size);
         memset(&gc->items[i], 0, sizeof(gc_ptr_t)); // clear items[i]
         /* move back slots forward */
         size_t j = i;
@@ -100,6 +209,7 @@ void gc_sweep(gc_t *gc)
                 break;
         }
         gc->items_cnt1--; // decrease the number of allocation as free it
+        // items[i] now holds the item moved forward, so check slot i again
     }
     // turn all the marked into unmarked
     for (size_t i = 0; i < gc->slots_cnt; i++)
@@ -125,7 +235,7 @@ void gc_sweep(gc_t *gc)
             {
                 gc->frees[i].dtor(gc->frees[i].ptr);
             }
-            free(gc->frees[i].ptr);
+            gc_heap_release(gc, gc->frees[i].ptr, gc->frees[i].size, gc->frees[i].node);
         }
     }
     free(gc->frees);
@@ -133,12 +243,78 @@ void gc_sweep(gc_t *gc)
     gc->frees_cnt = 0;
 }
 
+/* whether ptr lies where allocations are placed
+ * regions and heap images are mapped far away from malloc,
+ * so they are checked on their own instead of widening [min_ptr, max_ptr]
+ * */
+static int gc_in_heap(gc_t *gc, void *ptr)
+{
+    uintptr_t a = (uintptr_t)ptr;
+    if (a >= gc->min_ptr && a <= gc->max_ptr)
+    {
+        return 1;
+    }
+    // binary search the region holding a
+    void *base = (void *)(a & ~(uintptr_t)(GC_REGION_SIZE - 1));
+    size_t lo = 0, hi = gc->stats.regions_cnt;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (gc->regions[mid] == base)
+        {
+            return 1;
+        }
+        if ((uintptr_t)gc->regions[mid] < (uintptr_t)base)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    for (size_t i = 0; i < gc->images_cnt; i++)
+    {
+        if (a >= (uintptr_t)gc->images[i].addr && a - (uintptr_t)gc->images[i].addr < gc->images[i].size)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* record ptr, a scanned word in heap range missing every allocation, if blacklisting */
+static void gc_miss_add(gc_t *gc, void *ptr)
+{
+    if (!gc->blacklisting)
+    {
+        return;
+    }
+    if (gc->misses_cnt == gc->misses_cap)
+    {
+        size_t cap = gc->misses_cap ? gc->misses_cap * 2 : 64;
+        uintptr_t *misses = realloc(gc->misses, cap * sizeof(uintptr_t));
+        if (misses == NULL) // the word just goes unnoticed
+        {
+            return;
+        }
+        gc->misses = misses;
+        gc->misses_cap = cap;
+    }
+    gc->misses[gc->misses_cnt++] = (uintptr_t)ptr;
+}
+
 /* mark allocation pointed by ptr */
 static void gc_mark_ptr(gc_t *gc, void *ptr)
 {
-    // not between the range,so ptr isn't pointing to an allocation
-    if ((uintptr_t)ptr < gc->min_ptr || (uintptr_t)ptr > gc->max_ptr)
+    // not in the heap,so ptr isn't pointing to an allocation
+    if (!gc_in_heap(gc, ptr))
+    {
+        return;
+    }
+    if (gc->slots_cnt == 0) // regions or images may outlive all allocations
     {
+        gc_miss_add(gc, ptr);
         return;
     }
     size_t i = gc_hash(ptr) % gc->slots_cnt; // the index where the ptr shoud be in hashtable
@@ -148,6 +324,7 @@ static void gc_mark_ptr(gc_t *gc, void *ptr)
         size_t h = gc->items[i].hash;
         if (h == 0 || j > gc_offset(gc, i, h)) // means there is no pointer == ptr pointing to an allocation
         {
+            gc_miss_add(gc, ptr); // blacklisted after marking unless it lies inside a live allocation
             return;
         }
         // hashvalue != 0 && j = gc_offset(gc, i, h)
@@ -188,22 +365,35 @@ static void gc_mark_stack(gc_t *gc)
     int x;
     void *bottom = gc->bottom;
     void *top = &x; // acquire the stack top pointer at the point of x definition
+    uintptr_t align = sizeof(void *) - 1;
     if (bottom < top)
     {
+        top = (void *)((uintptr_t)top & ~align); // align to word inside the stack
+        bottom = (void *)(((uintptr_t)bottom + align) & ~align); // no word read before bottom
         for (void *p = top; p >= bottom; p = (void *)((uintptr_t)p - sizeof(void *)))
         {
-            gc_mark_ptr(gc, p);
+            gc_mark_ptr(gc, *(void **)p); // the word stored in the stack
         }
     }
-    if (bottom > top)
+    else if (bottom > top)
     {
+        top = (void *)(((uintptr_t)top + align) & ~align); // align to word inside the stack
+        bottom = (void *)((uintptr_t)bottom & ~align); // the last word read is the one holding bottom
         for (void *p = top; p <= bottom; p = (void *)((uintptr_t)p + sizeof(void *)))
         {
-            gc_mark_ptr(gc, p);
+            gc_mark_ptr(gc, *(void **)p); // the word stored in the stack
         }
     }
     return;
 }
+/* mark from the local slots registered in handle scopes */
+static void gc_mark_roots(gc_t *gc)
+{
+    for (size_t i = 0; i < gc->roots_cnt; i++)
+    {
+        gc_mark_ptr(gc, *gc->roots[i]);
+    }
+}
 /* mark from heap */
 static void gc_mark_heap(gc_t *gc)
 {
@@ -242,8 +432,17 @@ static void gc_mark_heap(gc_t *gc)
 /* mark operation  */
 static void gc_mark(gc_t *gc)
 {
+    if (gc->blacklisting)
+    {
+        gc_blacklist_rotate(gc);
+    }
     void (*volatile mark_heap)(gc_t *) = gc_mark_heap;
     mark_heap(gc);
+    if (gc->precise) // only registered slots hold pointers, no need to walk the stack
+    {
+        gc_mark_roots(gc);
+        return;
+    }
     jmp_buf env;                      // jmp_buf variable
     void (*volatile mark_stack)(gc_t *) = gc_mark_stack;
     memset(&env, 0, sizeof(jmp_buf)); // clear the jmp_buf env
@@ -254,19 +453,54 @@ static void gc_mark(gc_t *gc)
     mark_stack(gc);
 }
 
-/* stop gc */
+/* stop gc
+ * regions and heap images are unmapped, so roots placed in them are no longer valid either
+ * */
 void gc_stop(gc_t *gc)
 {
     gc_sweep(gc);
+    gc_release_held(gc, 1);
+    free(gc->held);
+    free(gc->chunks);
+    free(gc->misses);
     free(gc->items);
     free(gc->frees);
+    free(gc->sites);
+    free(gc->sites_index);
+    free(gc->roots);
+    free(gc->scopes);
+#ifdef GC_HAVE_REGIONS
+    for (size_t i = 0; i < gc->stats.regions_cnt; i++)
+    {
+        munmap(gc->regions[i], GC_REGION_SIZE);
+    }
+#endif
+    free(gc->regions);
+#ifdef GC_HAVE_MMAP
+    for (size_t i = 0; i < gc->images_cnt; i++)
+    {
+        if (gc->images[i].addr != NULL)
+        {
+            munmap(gc->images[i].addr, gc->images[i].size);
+        }
+    }
+#endif
+    free(gc->images);
 }
 
 /* an iteration of mark and sweep */
 void gc_run(gc_t *gc)
 {
     gc_mark(gc);
+    if (!gc->blacklisting)
+    {
+        gc_sweep(gc);
+        return;
+    }
+    gc_blacklist_misses(gc);
     gc_sweep(gc);
+    // held blocks no longer blacklisted can be handed out again
+    gc_release_held(gc, 0);
 }
 
 /* hash function */
@@ -279,10 +513,10 @@ static size_t gc_hash(void *ptr)
 // calculate the offset
 static size_t gc_offset(gc_t *gc, size_t i, size_t h)
 {
-    // h - represent the original location of item
+    // h - represent the original location of item plus 1(0 is kept for empty slots)
     // i - represent the current location of item
-    // v = i - h represent the offset because of hash conflict
-    long v = i - h;
+    // v = i - (h - 1) represent the offset because of hash conflict
+    long v = i - (h - 1);
     if (v < 0)
     {
         v = gc->slots_cnt + v;
@@ -290,8 +524,10 @@ static size_t gc_offset(gc_t *gc, size_t i, size_t h)
     return v;
 }
 
-/* insert gc_ptr_t into gc_items which is a hashtable actually */
-static void gc_insert_item(gc_t *gc, void *ptr, size_t size, int flags, void (*dtor)(void *))
+/* insert gc_ptr_t into gc_items which is a hashtable actually
+ * return the slot where the new item finally settles
+ * */
+static gc_ptr_t *gc_insert_item(gc_t *gc, void *ptr, size_t size, int flags, void (*dtor)(void *))
 {
     // calculate the hash value with ptr as a key
     size_t i = gc_hash(ptr) % gc->slots_cnt; // Remainder operation
@@ -301,7 +537,10 @@ static void gc_insert_item(gc_t *gc, void *ptr, size_t size, int flags, void (*d
     item.flags = flags;
     item.size = size;
     item.dtor = dtor;
-    item.hash = i; // the location of the slot where it should be at start
+    item.site = 0;
+    item.node = GC_HEAP_MALLOC;
+    item.hash = i + 1; // the location of the slot where it should be at start, plus 1
+    gc_ptr_t *slot = NULL; // where the new item settles
     while (1)
     {
         size_t h = gc->items[i].hash;
@@ -326,11 +565,15 @@ static void gc_insert_item(gc_t *gc, void *ptr, size_t size, int flags, void (*d
             gc->items[i] = item;
             item = tmp;
             j = v;
+            if (slot == NULL)
+            {
+                slot = &gc->items[i];
+            }
         }
         i = (i + 1) % gc->slots_cnt; // Linear detection method
         j++;                         // j represents steps that i moves
     }
-    return;
+    return slot ? slot : &gc->items[i];
 }
 
 /*  since the size of slots changes
@@ -354,9 +597,11 @@ static void gc_rehash(gc_t *gc, size_t new_size)
     {
         if (old_items[i].hash != 0)
         {
-            gc_insert_item(gc,
+            gc_ptr_t *p = gc_insert_item(gc,
                        old_items[i].ptr, old_items[i].size,
                        old_items[i].flags, old_items[i].dtor);
+            p->site = old_items[i].site;
+            p->node = old_items[i].node;
         }
     }
     free(old_items);
@@ -402,19 +647,36 @@ static void gc_adjust_slots(gc_t *gc)
     return;
 }
 
-/* add items */
-static void *gc_add_item(gc_t *gc, void *ptr, size_t size, int flags, void (*dtor)(void *))
+/* add items, node is where the allocation was placed by gc_heap_alloc */
+static void *gc_add_item(gc_t *gc, void *ptr, size_t size, int flags, void (*dtor)(void *), int node)
 {
     gc->items_cnt1++; // number of allocations allocated total
-    /* adjust the range of heap because of adding a new allocation */
-    gc->max_ptr = ((uintptr_t)ptr) + size > gc->max_ptr ? ((uintptr_t)ptr) + size : gc->max_ptr;
-    gc->min_ptr = ((uintptr_t)ptr) < gc->min_ptr ? ((uintptr_t)ptr) : gc->min_ptr;
+    /* adjust the range of malloc heap because of adding a new allocation */
+    if (node == GC_HEAP_MALLOC)
+    {
+        gc->max_ptr = ((uintptr_t)ptr) + size > gc->max_ptr ? ((uintptr_t)ptr) + size : gc->max_ptr;
+        gc->min_ptr = ((uintptr_t)ptr) < gc->min_ptr ? ((uintptr_t)ptr) : gc->min_ptr;
+    }
     gc_adjust_slots(gc); // since adding an item,so try to expand slots
-    gc_insert_item(gc, ptr, size, flags, dtor);
+    size_t site = 0;
+    if (gc->profiling) // the only cost on the allocation path while profiler is off
+    {
+        site = gc_profile_sample(gc, size);
+    }
+    gc_ptr_t *p = gc_insert_item(gc, ptr, size, flags, dtor);
+    p->site = site;
+    p->node = node;
     // automatically sweeping
     if (!gc->paused && gc->items_cnt1 > gc->items_cnt2)
     {
-        gc_run(gc);
+        // in precise mode ptr isn't stored in any registered slot yet,
+        // so keep it as a root during this collection
+        size_t roots_cnt = gc->roots_cnt;
+        if (!gc->precise || gc_root_local(gc, &ptr) == 0)
+        {
+            gc_run(gc);
+        }
+        gc->roots_cnt = roots_cnt;
     }
     return ptr;
 }
@@ -437,6 +699,7 @@ static void gc_delete_item(gc_t *gc, void *ptr)
         }
         if (gc->items[i].ptr == ptr)
         {
+            gc_profile_release(gc, gc->items[i].site, gc->items[i].size);
             memset(&gc->items[i], 0, sizeof(gc_ptr_t));
             j = i;
             while (1)
@@ -475,14 +738,55 @@ void gc_free(gc_t *gc, void *ptr)
         {
             p->dtor(ptr);
         }
-        free(ptr);                  // free the memory allocation pointed by ptr
-        gc_delete_item(gc, ptr);    // delete gc_ptr_t item from gc->items
+        size_t size = p->size;
+        int node = p->node;
+        gc_delete_item(gc, ptr);                // delete gc_ptr_t item from gc->items
+        gc_heap_release(gc, ptr, size, node);   // free the memory allocation pointed by ptr
+    }
+}
+
+/* realloc allocation p placed in a region or a heap image with size bytes */
+static void *gc_heap_realloc(gc_t *gc, gc_ptr_t *p, size_t size)
+{
+    void *ptr = p->ptr;
+    size_t old_size = p->size;
+    int old_node = p->node;
+    if (size == 0) // same as realloc, the allocation is freed
+    {
+        gc_delete_item(gc, ptr);
+        gc_heap_release(gc, ptr, old_size, old_node);
+        return NULL;
+    }
+    // the block of its size class still has room, just modify the allocation size
+    if (old_node >= 0 && size <= GC_CLASS_MAX && gc_size_class(size) == gc_size_class(old_size))
+    {
+        if (p->site)
+        {
+            gc->sites[p->site - 1].live_bytes += size - old_size;
+        }
+        gc->stats.node_bytes[old_node] += size - old_size;
+        p->size = size;
+        return ptr;
+    }
+    int node;
+    void *qtr = gc_heap_alloc(gc, size, 0, &node);
+    if (qtr == NULL)
+    {
+        return NULL;
     }
+    memcpy(qtr, ptr, size < old_size ? size : old_size);
+    int flags = p->flags;
+    void (*dtor)(void *) = p->dtor;
+    gc_delete_item(gc, ptr);
+    gc_heap_release(gc, ptr, old_size, old_node);
+    gc_add_item(gc, qtr, size, flags, dtor, node);
+    return qtr;
 }
 
 /* realloc allocation pointed by ptr with size bytes */
 void *gc_realloc(gc_t *gc, void *ptr, size_t size)
 {
+    GC_PROFILE_ENTRY(gc);
     /* 
     *   if ptr isn't pointing to an allocation item in gc->items
     *   it is an undefined behavior,then it will return NULL
@@ -490,6 +794,10 @@ void *gc_realloc(gc_t *gc, void *ptr, size_t size)
     gc_ptr_t *p = gc_get_item(gc, ptr);
     if(p == NULL)
         return NULL;
+    if (p->node != GC_HEAP_MALLOC)
+    {
+        return gc_heap_realloc(gc, p, size);
+    }
     void *qtr = realloc(ptr, size);
     if (qtr == NULL)
     {
@@ -520,7 +828,7 @@ void *gc_realloc(gc_t *gc, void *ptr, size_t size)
             *   then it allocate a new allocation without freeing ptr(NULL)
             *   then add the new gc_ptr_t item into gc->items
             *  */
-            gc_add_item(gc, qtr, size, 0, NULL);
+            gc_add_item(gc, qtr, size, 0, NULL, GC_HEAP_MALLOC);
             return qtr;
         }
         if(ptr != NULL && size != 0)
@@ -532,6 +840,10 @@ void *gc_realloc(gc_t *gc, void *ptr, size_t size)
             *  */
             if (p && qtr == ptr)
             {
+                if (p->site)
+                {
+                    gc->sites[p->site - 1].live_bytes += size - p->size;
+                }
                 p->size = size;
                 return qtr;
             }
@@ -550,7 +862,7 @@ void *gc_realloc(gc_t *gc, void *ptr, size_t size)
                 *   we just need to remove corresponding gc_ptr_t from gc->items
                 *  */
                 gc_delete_item(gc, ptr);
-                gc_add_item(gc, qtr, size, flags, dtor);
+                gc_add_item(gc, qtr, size, flags, dtor, GC_HEAP_MALLOC);
                 return qtr;
             }
         }
@@ -584,16 +896,25 @@ static gc_ptr_t *gc_get_item(gc_t *gc, void *ptr)
 /* alloc the size bytes of allocation */
 void *gc_alloc(gc_t *gc, size_t size)
 {
-    return gc_alloc_opt(gc, size, 0, NULL);
+    GC_PROFILE_ENTRY(gc);
+    return gc_alloc_item(gc, size, 0, NULL);
 }
 
 /* alloc the size bytes of allocation with flags and dtor */
 void *gc_alloc_opt(gc_t *gc, size_t size, int flags, void (*dtor)(void *))
 {
-    void *ptr = malloc(size);
+    GC_PROFILE_ENTRY(gc);
+    return gc_alloc_item(gc, size, flags, dtor);
+}
+
+/* alloc the size bytes of allocation with flags and dtor, behind gc_alloc and gc_alloc_opt */
+static void *gc_alloc_item(gc_t *gc, size_t size, int flags, void (*dtor)(void *))
+{
+    int node;
+    void *ptr = gc_heap_alloc(gc, size, 0, &node);
     if (ptr != NULL)
     {
-        ptr = gc_add_item(gc, ptr, size, flags, dtor);
+        ptr = gc_add_item(gc, ptr, size, flags, dtor, node);
     }
     return ptr;
 }
@@ -601,16 +922,29 @@ void *gc_alloc_opt(gc_t *gc, size_t size, int flags, void (*dtor)(void *))
 /* alloc (num * size) bytes of allocation */
 void *gc_calloc(gc_t *gc, size_t num, size_t size)
 {
-    return gc_calloc_opt(gc, num, size, 0, NULL);
+    GC_PROFILE_ENTRY(gc);
+    return gc_calloc_item(gc, num, size, 0, NULL);
 }
 
 /* alloc (num * size) bytes of allocation with flags and dtor */
 void *gc_calloc_opt(gc_t *gc, size_t num, size_t size, int flags, void (*dtor)(void *))
 {
-    void *ptr = calloc(num, size);
+    GC_PROFILE_ENTRY(gc);
+    return gc_calloc_item(gc, num, size, flags, dtor);
+}
+
+/* alloc (num * size) bytes of allocation with flags and dtor, behind gc_calloc and gc_calloc_opt */
+static void *gc_calloc_item(gc_t *gc, size_t num, size_t size, int flags, void (*dtor)(void *))
+{
+    if (size != 0 && num > SIZE_MAX / size) // num * size overflows
+    {
+        return NULL;
+    }
+    int node;
+    void *ptr = gc_heap_alloc(gc, num * size, 1, &node);
     if (ptr != NULL)
     {
-        ptr = gc_add_item(gc, ptr, num * size, flags, dtor);
+        ptr = gc_add_item(gc, ptr, num * size, flags, dtor, node);
     }
     return ptr;
 }
@@ -674,4 +1008,1134 @@ size_t gc_get_size(gc_t *gc, void *ptr)
         return p->size;
     }
     return 0;
-}
\ No newline at end of file
+}
+/* open a handle scope
+ * slots registered after it are unregistered by the matching gc_scope_leave
+ * return 0 on success, -1 on failure
+ * */
+int gc_scope_enter(gc_t *gc)
+{
+    if (gc->scopes_cnt == gc->scopes_cap)
+    {
+        size_t cap = gc->scopes_cap ? gc->scopes_cap * 2 : 16;
+        size_t *scopes = realloc(gc->scopes, cap * sizeof(size_t));
+        if (scopes == NULL)
+        {
+            return -1;
+        }
+        gc->scopes = scopes;
+        gc->scopes_cap = cap;
+    }
+    gc->scopes[gc->scopes_cnt++] = gc->roots_cnt;
+    return 0;
+}
+
+/* close the innermost handle scope and unregister its slots */
+void gc_scope_leave(gc_t *gc)
+{
+    if (gc->scopes_cnt == 0)
+    {
+        return;
+    }
+    gc->roots_cnt = gc->scopes[--gc->scopes_cnt];
+}
+
+/* register slot, the address of a local pointer variable, as a root
+ * the variable is read at every collection until its scope is left
+ * return 0 on success, -1 on failure
+ * */
+int gc_root_local(gc_t *gc, void *slot)
+{
+    if (gc->roots_cnt == gc->roots_cap)
+    {
+        size_t cap = gc->roots_cap ? gc->roots_cap * 2 : 64;
+        void ***roots = realloc(gc->roots, cap * sizeof(void **));
+        if (roots == NULL)
+        {
+            return -1;
+        }
+        gc->roots = roots;
+        gc->roots_cap = cap;
+    }
+    gc->roots[gc->roots_cnt++] = slot;
+    return 0;
+}
+
+/* natural logarithm of x in (0, 1], so that libm isn't needed */
+static double gc_log(double x)
+{
+    int e = 0;
+    while (x < 1.0) // x = m / 2^e with m in [1, 2)
+    {
+        x *= 2;
+        e++;
+    }
+    // ln(m) = 2 * atanh(t) with t = (m - 1) / (m + 1) below 1/3
+    double t = (x - 1) / (x + 1), t2 = t * t;
+    double s = 1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 * (1.0 / 9 + t2 / 11))));
+    return 2 * t * s - e * 0.69314718055994531;
+}
+
+/* random interval until the next sample, exponential with mean gc->prof_rate like tcmalloc
+ * so the samples are a poisson process, which pprof assumes when it unsamples heap_v2 profiles
+ * */
+static size_t gc_profile_interval(gc_t *gc)
+{
+    // xorshift64 generator
+    uint64_t x = gc->prof_seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    gc->prof_seed = x;
+    double u = (double)((x >> 11) + 1) / 9007199254740992.0; // uniform in (0, 1], 2^53 steps
+    return 1 + (size_t)(-gc_log(u) * (double)gc->prof_rate);
+}
+
+#ifdef GC_HAVE_UNWIND
+typedef struct gc_unwind{
+    uintptr_t entry;    // stack address inside the collector call being made
+    int skipping;       // still walking the frames of the collector
+    void **frames;      // return addresses recorded
+    int depth;          // number of frames recorded
+}gc_unwind_t;
+
+/* record one frame of the call stack, skipping the collector's own frames */
+static _Unwind_Reason_Code gc_unwind_frame(struct _Unwind_Context *ctx, void *arg)
+{
+    gc_unwind_t *u = arg;
+    // the stack pointer of a frame at its call is below entry as long as the frame
+    // belongs to the collector, whatever got inlined into the collector entry
+    if (u->skipping && _Unwind_GetCFA(ctx) <= u->entry)
+    {
+        return _URC_NO_REASON;
+    }
+    u->skipping = 0;
+    void *pc = (void *)_Unwind_GetIP(ctx);
+    if (pc == NULL)
+    {
+        return _URC_END_OF_STACK;
+    }
+    u->frames[u->depth++] = pc;
+    return u->depth < GC_PROFILE_DEPTH ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+#endif
+
+/* hash function of a call stack */
+static size_t gc_profile_hash(void **frames, int depth)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (int k = 0; k < depth; k++)
+    {
+        h = (h ^ (uint64_t)(uintptr_t)frames[k]) * 0x100000001B3ULL;
+        h ^= h >> 29;
+    }
+    return (size_t)h;
+}
+
+/* rebuild sites_index with slots_cnt slots
+ * return 0 on success, -1 on failure
+ * */
+static int gc_profile_reindex(gc_t *gc, size_t slots_cnt)
+{
+    size_t *index = calloc(slots_cnt, sizeof(size_t));
+    if (index == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < gc->sites_cnt; i++)
+    {
+        size_t k = gc->sites[i].hash & (slots_cnt - 1);
+        while (index[k] != 0)
+        {
+            k = (k + 1) & (slots_cnt - 1);
+        }
+        index[k] = i + 1;
+    }
+    free(gc->sites_index);
+    gc->sites_index = index;
+    gc->index_cnt = slots_cnt;
+    return 0;
+}
+
+/* account size bytes of allocation to the profiler
+ * return index+1 of the call site in gc->sites if it is sampled, 0 otherwise
+ * */
+static size_t gc_profile_sample(gc_t *gc, size_t size)
+{
+    if (size < gc->prof_left) // not yet reached the next sample
+    {
+        gc->prof_left -= size;
+        return 0;
+    }
+    gc->prof_left = gc_profile_interval(gc);
+    // record the call stack of this allocation
+    // starting from the caller of the collector
+    void *frames[GC_PROFILE_DEPTH];
+    int depth = 0;
+#ifdef GC_HAVE_UNWIND
+    gc_unwind_t u = {gc->prof_entry, 1, frames, 0};
+    _Unwind_Backtrace(gc_unwind_frame, &u);
+    depth = u.depth;
+#endif
+    // keep the index at most half full
+    if (2 * (gc->sites_cnt + 1) > gc->index_cnt &&
+        gc_profile_reindex(gc, gc->index_cnt ? gc->index_cnt * 2 : 128) != 0)
+    {
+        return 0;
+    }
+    // find the call site with the same call stack
+    size_t hash = gc_profile_hash(frames, depth);
+    size_t k = hash & (gc->index_cnt - 1);
+    size_t i = gc->sites_cnt;
+    while (gc->sites_index[k] != 0)
+    {
+        gc_site_t *s = &gc->sites[gc->sites_index[k] - 1];
+        if (s->hash == hash && s->depth == depth &&
+            memcmp(s->frames, frames, depth * sizeof(void *)) == 0)
+        {
+            i = gc->sites_index[k] - 1;
+            break;
+        }
+        k = (k + 1) & (gc->index_cnt - 1);
+    }
+    // a new call site, add it into gc->sites
+    if (i == gc->sites_cnt)
+    {
+        if (gc->sites_cnt == gc->sites_cap)
+        {
+            size_t cap = gc->sites_cap ? gc->sites_cap * 2 : 64;
+            gc_site_t *sites = realloc(gc->sites, cap * sizeof(gc_site_t));
+            if (sites == NULL) // failed to grow, just drop this sample
+            {
+                return 0;
+            }
+            gc->sites = sites;
+            gc->sites_cap = cap;
+        }
+        memset(&gc->sites[i], 0, sizeof(gc_site_t));
+        memcpy(gc->sites[i].frames, frames, depth * sizeof(void *));
+        gc->sites[i].depth = depth;
+        gc->sites[i].hash = hash;
+        gc->sites_index[k] = i + 1; // k is the empty slot where the search stopped
+        gc->sites_cnt++;
+    }
+    gc_site_t *s = &gc->sites[i];
+    s->alloc_cnt++;
+    s->alloc_bytes += size;
+    s->live_cnt++;
+    s->live_bytes += size;
+    return i + 1;
+}
+
+/* a sampled allocation of size bytes is freed, it is no longer live */
+static void gc_profile_release(gc_t *gc, size_t site, size_t size)
+{
+    if (site == 0) // not sampled
+    {
+        return;
+    }
+    gc->sites[site - 1].live_cnt--;
+    gc->sites[site - 1].live_bytes -= size;
+}
+
+/* start sampling about one allocation every rate bytes */
+void gc_profile_start(gc_t *gc, size_t rate)
+{
+    gc->prof_rate = rate ? rate : 1;
+    if (gc->prof_seed == 0)
+    {
+        gc->prof_seed = (uint64_t)(uintptr_t)gc ^ 0x9E3779B97F4A7C15ULL;
+    }
+    gc->prof_left = gc_profile_interval(gc);
+    gc->profiling = 1;
+}
+
+/* stop sampling
+ * allocations already sampled are still tracked until they are freed
+ * */
+void gc_profile_stop(gc_t *gc)
+{
+    gc->profiling = 0;
+}
+
+/* write the samples in the legacy heap profile format read by pprof
+ * every call site reports its live and allocated samples
+ * return 0 on success, -1 on failure
+ * */
+int gc_profile_dump(gc_t *gc, FILE *fp)
+{
+    size_t live_cnt = 0, live_bytes = 0, alloc_cnt = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < gc->sites_cnt; i++)
+    {
+        live_cnt += gc->sites[i].live_cnt;
+        live_bytes += gc->sites[i].live_bytes;
+        alloc_cnt += gc->sites[i].alloc_cnt;
+        alloc_bytes += gc->sites[i].alloc_bytes;
+    }
+    fprintf(fp, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            live_cnt, live_bytes, alloc_cnt, alloc_bytes, gc->prof_rate);
+    for (size_t i = 0; i < gc->sites_cnt; i++)
+    {
+        gc_site_t *s = &gc->sites[i];
+        fprintf(fp, "%zu: %zu [%zu: %zu] @",
+                s->live_cnt, s->live_bytes, s->alloc_cnt, s->alloc_bytes);
+        for (int k = 0; k < s->depth; k++)
+        {
+            fprintf(fp, " %p", s->frames[k]);
+        }
+        fprintf(fp, "\n");
+    }
+    // memory mappings let pprof symbolize the addresses
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps)
+    {
+        char buf[4096];
+        size_t n;
+        fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+        while ((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+        {
+            fwrite(buf, 1, n, fp);
+        }
+        fclose(maps);
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+/* the size class whose blocks hold size bytes */
+static size_t gc_size_class(size_t size)
+{
+    size_t c = 0;
+    while ((GC_CLASS_MIN << c) < size)
+    {
+        c++;
+    }
+    return c;
+}
+
+/* numa node of the cpu running the calling thread, -1 if unknown */
+static int gc_current_node(void)
+{
+#ifdef GC_HAVE_REGIONS
+    unsigned int cpu, node;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    if (getcpu(&cpu, &node) == 0)
+#else
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+#endif
+    {
+        return (int)node;
+    }
+#endif
+    return -1;
+}
+
+/* reserve a new aligned region on node and make it the current region of node
+ * return 0 on success, -1 on failure
+ * */
+static int gc_reserve_region(gc_t *gc, int node)
+{
+#ifdef GC_HAVE_REGIONS
+    if (gc->stats.regions_cnt == gc->regions_cap)
+    {
+        size_t cap = gc->regions_cap ? gc->regions_cap * 2 : 16;
+        void **regions = realloc(gc->regions, cap * sizeof(void *));
+        if (regions == NULL)
+        {
+            return -1;
+        }
+        gc->regions = regions;
+        gc->regions_cap = cap;
+    }
+    // map twice the size, then trim it to an aligned region
+    // so that the whole region can be backed by one huge page
+    size_t len = 2 * GC_REGION_SIZE;
+    char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        return -1;
+    }
+    char *base = (char *)(((uintptr_t)p + GC_REGION_SIZE - 1) & ~(uintptr_t)(GC_REGION_SIZE - 1));
+    if (base > p)
+    {
+        munmap(p, base - p);
+    }
+    munmap(base + GC_REGION_SIZE, p + len - (base + GC_REGION_SIZE));
+#ifdef MADV_HUGEPAGE
+    if (madvise(base, GC_REGION_SIZE, MADV_HUGEPAGE) == 0)
+    {
+        gc->stats.regions_huge++;
+    }
+#endif
+#ifdef SYS_mbind
+    // prefer the pages of the region on node, MPOL_PREFERRED is 1
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, base, GC_REGION_SIZE, 1, &mask, sizeof(mask) * 8, 0);
+#endif
+#ifdef SYS_get_mempolicy
+    // touch the first page and ask where it was placed, MPOL_F_NODE | MPOL_F_ADDR is 3
+    int placed = -1;
+    base[0] = 0;
+    if (syscall(SYS_get_mempolicy, &placed, NULL, 0, base, 3) == 0 && placed == node)
+    {
+        gc->stats.regions_local++;
+    }
+#endif
+    // keep regions sorted for gc_in_heap
+    size_t k = gc->stats.regions_cnt;
+    while (k > 0 && (uintptr_t)gc->regions[k - 1] > (uintptr_t)base)
+    {
+        gc->regions[k] = gc->regions[k - 1];
+        k--;
+    }
+    gc->regions[k] = base;
+    gc->stats.regions_cnt++;
+    gc->nodes[node].cur = base;
+    gc->nodes[node].end = base + GC_REGION_SIZE;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* place size bytes, zeroed if zero is set, in a region of the caller's numa node if heap is on
+ * node is set to the node of that region, or GC_HEAP_MALLOC if it comes from malloc
+ * */
+static void *gc_heap_place(gc_t *gc, size_t size, int zero, int *node)
+{
+    *node = GC_HEAP_MALLOC;
+    if (!gc->heap)
+    {
+        return zero ? calloc(size, 1) : malloc(size);
+    }
+    int n = gc_current_node();
+    if (size > GC_CLASS_MAX || n < 0 || n >= GC_MAX_NODES)
+    {
+        return zero ? calloc(size, 1) : malloc(size);
+    }
+    size_t c = gc_size_class(size);
+    gc_node_t *nd = &gc->nodes[n];
+    void *ptr = nd->free[c];
+    if (ptr != NULL) // reuse a released block
+    {
+        nd->free[c] = *(void **)ptr;
+    }
+    else // carve a new block from the current region
+    {
+        size_t block = GC_CLASS_MIN << c;
+        while (1)
+        {
+            if ((size_t)(nd->end - nd->cur) < block && gc_reserve_region(gc, n) != 0)
+            {
+                return zero ? calloc(size, 1) : malloc(size);
+            }
+            if (!gc_blacklisted(gc, nd->cur, block))
+            {
+                break;
+            }
+            // never carve from a page hit by a false pointer, skip the rest of it instead
+            nd->cur = (char *)(((uintptr_t)nd->cur | (((uintptr_t)1 << GC_PAGE_SHIFT) - 1)) + 1);
+        }
+        ptr = nd->cur;
+        nd->cur += block;
+    }
+    *node = n;
+    if (zero) // blocks from a region may be reused
+    {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/* find the chunk of the blacklist numbered key, add it if create is set
+ * return NULL if it is absent, or can't be added
+ * */
+static gc_chunk_t *gc_chunk_find(gc_t *gc, uintptr_t key, int create)
+{
+    if (create && 2 * (gc->chunks_cnt + 1) > gc->chunks_slots) // keep it at most half full
+    {
+        size_t slots = gc->chunks_slots ? gc->chunks_slots * 2 : 16;
+        gc_chunk_t *chunks = calloc(slots, sizeof(gc_chunk_t));
+        if (chunks == NULL)
+        {
+            return NULL;
+        }
+        for (size_t i = 0; i < gc->chunks_slots; i++)
+        {
+            if (gc->chunks[i].key == 0)
+            {
+                continue;
+            }
+            size_t j = (size_t)(gc->chunks[i].key * 0x9E3779B97F4A7C15ULL) & (slots - 1);
+            while (chunks[j].key != 0)
+            {
+                j = (j + 1) & (slots - 1);
+            }
+            chunks[j] = gc->chunks[i];
+        }
+        free(gc->chunks);
+        gc->chunks = chunks;
+        gc->chunks_slots = slots;
+    }
+    if (gc->chunks_slots == 0)
+    {
+        return NULL;
+    }
+    size_t i = (size_t)((key + 1) * 0x9E3779B97F4A7C15ULL) & (gc->chunks_slots - 1);
+    while (gc->chunks[i].key != 0)
+    {
+        if (gc->chunks[i].key == key + 1)
+        {
+            return &gc->chunks[i];
+        }
+        i = (i + 1) & (gc->chunks_slots - 1);
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+    gc->chunks[i].key = key + 1;
+    gc->chunks_cnt++;
+    return &gc->chunks[i];
+}
+
+/* record ptr, a scanned word in heap range, as an address hit by a false pointer
+ * the whole page holding ptr is blacklisted
+ * */
+static void gc_blacklist_add(gc_t *gc, void *ptr)
+{
+    gc->stats.false_hits++;
+    uintptr_t page = (uintptr_t)ptr >> GC_PAGE_SHIFT;
+    gc_chunk_t *c = gc_chunk_find(gc, page / GC_CHUNK_PAGES, 1);
+    if (c != NULL)
+    {
+        size_t b = page % GC_CHUNK_PAGES;
+        c->pages[0][b / 64] |= (uint64_t)1 << (b % 64);
+    }
+}
+
+/* whether a page of the size bytes at ptr was hit by a false pointer during the last two collections */
+static int gc_blacklisted(gc_t *gc, void *ptr, size_t size)
+{
+    if (gc->chunks_cnt == 0)
+    {
+        return 0;
+    }
+    uintptr_t first = (uintptr_t)ptr >> GC_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t)ptr + (size ? size - 1 : 0)) >> GC_PAGE_SHIFT;
+    for (uintptr_t page = first; page <= last; page++)
+    {
+        gc_chunk_t *c = gc_chunk_find(gc, page / GC_CHUNK_PAGES, 0);
+        size_t b = page % GC_CHUNK_PAGES;
+        if (c != NULL && ((c->pages[0][b / 64] | c->pages[1][b / 64]) >> (b % 64) & 1))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* age the blacklist before a collection
+ * the hits of the last collection become old, hits older than that are forgotten
+ * chunks left without hits are dropped
+ * */
+static void gc_blacklist_rotate(gc_t *gc)
+{
+    gc_chunk_t *chunks = gc->chunks;
+    size_t slots = gc->chunks_slots;
+    gc->chunks = NULL;
+    gc->chunks_cnt = 0;
+    gc->chunks_slots = 0;
+    for (size_t i = 0; i < slots; i++)
+    {
+        uint64_t hits = 0;
+        for (size_t k = 0; k < GC_CHUNK_PAGES / 64; k++)
+        {
+            hits |= chunks[i].pages[0][k];
+        }
+        if (chunks[i].key == 0 || hits == 0)
+        {
+            continue;
+        }
+        gc_chunk_t *c = gc_chunk_find(gc, chunks[i].key - 1, 1);
+        if (c != NULL)
+        {
+            memcpy(c->pages[1], chunks[i].pages[0], sizeof(c->pages[1]));
+        }
+    }
+    free(chunks);
+}
+
+/* order words by value */
+static int gc_cmp_word(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a;
+    uintptr_t y = *(const uintptr_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* blacklist the words which missed every allocation during the last marking
+ * a word inside a live allocation, or just past its end, is an interior pointer rather than a false one
+ * */
+static void gc_blacklist_misses(gc_t *gc)
+{
+    size_t cnt = gc->misses_cnt;
+    gc->misses_cnt = 0;
+    if (cnt == 0)
+    {
+        return;
+    }
+    char *inside = calloc(cnt, 1);
+    if (inside == NULL)
+    {
+        return;
+    }
+    qsort(gc->misses, cnt, sizeof(uintptr_t), gc_cmp_word);
+    for (size_t i = 0; i < gc->slots_cnt; i++)
+    {
+        gc_ptr_t *p = &gc->items[i];
+        if (p->hash == 0 || !(p->flags & (GC_MARK | GC_ROOT)))
+        {
+            continue;
+        }
+        // binary search the first miss not below the allocation
+        size_t lo = 0, hi = cnt;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (gc->misses[mid] < (uintptr_t)p->ptr)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        for (size_t k = lo; k < cnt && gc->misses[k] - (uintptr_t)p->ptr <= p->size; k++)
+        {
+            inside[k] = 1;
+        }
+    }
+    for (size_t k = 0; k < cnt; k++)
+    {
+        if (!inside[k])
+        {
+            gc_blacklist_add(gc, (void *)gc->misses[k]); // looks like a pointer, so never allocate there
+        }
+    }
+    free(inside);
+}
+
+/* release the held blocks, only the ones no longer blacklisted unless all is set */
+static void gc_release_held(gc_t *gc, int all)
+{
+    size_t k = 0;
+    for (size_t i = 0; i < gc->held_cnt; i++)
+    {
+        gc_ptr_t *p = &gc->held[i];
+        if (!all && gc_blacklisted(gc, p->ptr, p->size))
+        {
+            gc->held[k++] = *p;
+            continue;
+        }
+        gc->stats.held_bytes -= p->size;
+        gc_heap_unplace(gc, p->ptr, p->size, p->node);
+    }
+    gc->held_cnt = k;
+}
+
+/* keep the size bytes at ptr placed on node from being handed out while blacklisted
+ * return 0 if it is held, -1 if it must be handed out anyway
+ * */
+static int gc_hold(gc_t *gc, void *ptr, size_t size, int node)
+{
+    if (gc->stats.held_bytes + size > GC_HELD_MAX)
+    {
+        return -1;
+    }
+    if (gc->held_cnt == gc->held_cap)
+    {
+        size_t cap = gc->held_cap ? gc->held_cap * 2 : 16;
+        gc_ptr_t *held = realloc(gc->held, cap * sizeof(gc_ptr_t));
+        if (held == NULL)
+        {
+            return -1;
+        }
+        gc->held = held;
+        gc->held_cap = cap;
+    }
+    memset(&gc->held[gc->held_cnt], 0, sizeof(gc_ptr_t));
+    gc->held[gc->held_cnt].ptr = ptr;
+    gc->held[gc->held_cnt].size = size;
+    gc->held[gc->held_cnt].node = node;
+    gc->held_cnt++;
+    gc->stats.held_bytes += size;
+    gc->stats.blacklisted++;
+    return 0;
+}
+
+/* allocate size bytes like gc_heap_place, but never at a blacklisted address
+ * since a false pointer to it would keep the allocation alive
+ * blacklisted blocks are held until they are no longer blacklisted, up to GC_HELD_MAX bytes
+ * */
+static void *gc_heap_alloc(gc_t *gc, size_t size, int zero, int *node)
+{
+    void *ptr = gc_heap_place(gc, size, zero, node);
+    // a large block spans many pages, one false pointer shouldn't withhold all of them
+    int tries = (!gc->blacklisting || size > GC_HELD_BLOCK_MAX) ? 0 : GC_BLACKLIST_TRIES;
+    for (int i = 0; ptr != NULL && i < tries && gc_blacklisted(gc, ptr, size); i++)
+    {
+        if (gc_hold(gc, ptr, size, *node) != 0) // can't hold it, so just hand it out
+        {
+            break;
+        }
+        ptr = gc_heap_place(gc, size, zero, node);
+    }
+    // count only the block handed out, held blocks never reach the caller
+    if (ptr != NULL && *node >= 0)
+    {
+        gc->stats.heap_hits++;
+        gc->stats.node_allocs[*node]++;
+        gc->stats.node_bytes[*node] += size;
+    }
+    else if (ptr != NULL && gc->heap)
+    {
+        gc->stats.heap_misses++;
+    }
+    return ptr;
+}
+
+/* give back size bytes at ptr placed on node by gc_heap_place, without touching the stats
+ * a block of a region goes back to the free list of its own node
+ * */
+static void gc_heap_unplace(gc_t *gc, void *ptr, size_t size, int node)
+{
+    if (node == GC_HEAP_MALLOC)
+    {
+        free(ptr);
+        return;
+    }
+    if (node <= GC_HEAP_IMAGE(0)) // its heap image is unmapped with the last object inside
+    {
+        gc_image_t *img = &gc->images[GC_IMAGE_INDEX(node)];
+        if (--img->live_cnt == 0)
+        {
+#ifdef GC_HAVE_MMAP
+            munmap(img->addr, img->size);
+#endif
+            img->addr = NULL;
+            img->size = 0;
+        }
+        return;
+    }
+    size_t c = gc_size_class(size);
+    *(void **)ptr = gc->nodes[node].free[c];
+    gc->nodes[node].free[c] = ptr;
+}
+
+/* release size bytes of allocation ptr placed on node by gc_heap_alloc */
+static void gc_heap_release(gc_t *gc, void *ptr, size_t size, int node)
+{
+    if (node >= 0)
+    {
+        gc->stats.node_bytes[node] -= size;
+    }
+    gc_heap_unplace(gc, ptr, size, node);
+}
+
+/* stop handing out blocks at addresses hit by false pointers during the last two collections
+ * it costs every collection a pass over the words missing all allocations
+ * */
+void gc_blacklist_start(gc_t *gc)
+{
+    gc->blacklisting = 1;
+}
+
+/* place the allocations up to 2048 bytes in huge page regions of the caller's numa node
+ * return 0 on success, -1 if regions are not supported on this platform
+ * */
+int gc_heap_start(gc_t *gc)
+{
+#ifdef GC_HAVE_REGIONS
+    gc->heap = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* copy the placement statistics into stats */
+void gc_get_stats(gc_t *gc, gc_stats_t *stats)
+{
+    *stats = gc->stats;
+}
+
+/* order gc_ptr_t pointers by the address of their allocation */
+static int gc_cmp_item(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)(*(gc_ptr_t *const *)a)->ptr;
+    uintptr_t y = (uintptr_t)(*(gc_ptr_t *const *)b)->ptr;
+    return x < y ? -1 : x > y;
+}
+
+/* find the index of allocation ptr in objs sorted by address, cnt if absent */
+static size_t gc_find_object(gc_ptr_t **objs, size_t cnt, void *ptr)
+{
+    size_t lo = 0, hi = cnt;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)objs[mid]->ptr < (uintptr_t)ptr)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo < cnt && objs[lo]->ptr == ptr) ? lo : cnt;
+}
+
+/* whether word k of allocation p holds a pointer according to layout
+ * without a layout every word of a non leaf allocation may hold one
+ * */
+static int gc_layout_word(gc_layout_t layout, gc_ptr_t *p, size_t k)
+{
+    if (p->flags & GC_LEAF) // no pointers inside a leaf
+    {
+        return 0;
+    }
+    return layout == NULL || layout(p->ptr, p->size, k);
+}
+
+/* write the cnt objects sorted by address into a heap image file at path */
+static int gc_snapshot_write(const char *path, gc_ptr_t **objs, size_t cnt,
+                             void **roots, size_t roots_cnt, gc_layout_t layout)
+{
+    int ret = -1;
+    gc_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GC_IMAGE_MAGIC, sizeof(header.magic));
+    header.word_size = sizeof(void *);
+    header.objects_cnt = cnt;
+    header.roots_cnt = roots_cnt;
+    // lay out the objects one after another
+    gc_image_object_t *table = malloc((cnt ? cnt : 1) * sizeof(gc_image_object_t));
+    uint64_t *indexes = malloc((roots_cnt ? roots_cnt : 1) * sizeof(uint64_t));
+    uint64_t *relocs = NULL;
+    size_t relocs_cap = 0;
+    char *data = NULL;
+    FILE *fp = NULL;
+    if (table == NULL || indexes == NULL)
+    {
+        goto done;
+    }
+    for (size_t i = 0; i < cnt; i++)
+    {
+        table[i].offset = header.data_size;
+        table[i].size = objs[i]->size;
+        table[i].flags = (uint64_t)(objs[i]->flags & ~GC_MARK);
+        // keep malloc alignment, an empty object still gets an address of its own
+        header.data_size += ((objs[i]->size ? objs[i]->size : 1) + 15) & ~(uint64_t)15;
+    }
+    for (size_t i = 0; i < roots_cnt; i++)
+    {
+        size_t k = gc_find_object(objs, cnt, roots[i]);
+        indexes[i] = k < cnt ? k : GC_IMAGE_NONE;
+    }
+    // copy the objects and turn the pointers between them into data offsets
+    data = calloc(header.data_size ? header.data_size : 1, 1);
+    if (data == NULL)
+    {
+        goto done;
+    }
+    for (size_t i = 0; i < cnt; i++)
+    {
+        memcpy(data + table[i].offset, objs[i]->ptr, objs[i]->size);
+        uintptr_t *words = (uintptr_t *)(data + table[i].offset);
+        for (size_t k = 0; k < objs[i]->size / sizeof(void *); k++)
+        {
+            if (!gc_layout_word(layout, objs[i], k))
+            {
+                continue;
+            }
+            size_t t = gc_find_object(objs, cnt, (void *)words[k]);
+            if (t == cnt && layout != NULL && words[k] != 0) // a pointer which can't be relocated
+            {
+                goto done;
+            }
+            if (t == cnt) // not pointing to an object of the image
+            {
+                continue;
+            }
+            if (header.relocs_cnt == relocs_cap)
+            {
+                relocs_cap = relocs_cap ? relocs_cap * 2 : 1024;
+                uint64_t *p = realloc(relocs, relocs_cap * sizeof(uint64_t));
+                if (p == NULL)
+                {
+                    goto done;
+                }
+                relocs = p;
+            }
+            relocs[header.relocs_cnt++] = table[i].offset + k * sizeof(void *);
+            words[k] = (uintptr_t)table[t].offset;
+        }
+    }
+    uint64_t meta = sizeof(header) + cnt * sizeof(gc_image_object_t) +
+                    (roots_cnt + header.relocs_cnt) * sizeof(uint64_t);
+    header.data_offset = (meta + GC_IMAGE_ALIGN - 1) & ~(GC_IMAGE_ALIGN - 1);
+    fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        goto done;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(table, sizeof(gc_image_object_t), cnt, fp);
+    fwrite(indexes, sizeof(uint64_t), roots_cnt, fp);
+    fwrite(relocs, sizeof(uint64_t), header.relocs_cnt, fp);
+    for (uint64_t i = meta; i < header.data_offset; i++) // pad up to the data
+    {
+        fputc(0, fp);
+    }
+    fwrite(data, 1, header.data_size, fp);
+    ret = ferror(fp) ? -1 : 0;
+done:
+    if (fp && fclose(fp) != 0)
+    {
+        ret = -1;
+    }
+    free(table);
+    free(indexes);
+    free(relocs);
+    free(data);
+    return ret;
+}
+
+/* write all allocations reachable from roots into a heap image file at path
+ * the pointers between them are recorded, so gc_restore can relocate the image
+ * layout tells which words of an allocation hold pointers, if NULL they are inferred:
+ * any word equal to the address of a traced allocation is taken as a pointer,
+ * so an integer happening to match one is rewritten by gc_restore and corrupted
+ * with a layout, a pointer word neither NULL nor the start of an allocation fails the snapshot
+ * destructors are not saved since their addresses don't survive the process
+ * return 0 on success, -1 on failure
+ * */
+int gc_snapshot(gc_t *gc, const char *path, void **roots, size_t roots_cnt, gc_layout_t layout)
+{
+    // trace the reachable allocations, objs is the queue of the traversal
+    gc_ptr_t **objs = NULL;
+    size_t cnt = 0, cap = 0;
+    int ret = 0;
+    for (size_t i = 0; gc->items_cnt1 > 0 && i < roots_cnt + cnt && ret == 0; i++)
+    {
+        void **words;
+        size_t words_cnt;
+        gc_ptr_t *from = NULL;
+        if (i < roots_cnt) // roots first
+        {
+            words = &roots[i];
+            words_cnt = 1;
+        }
+        else
+        {
+            from = objs[i - roots_cnt];
+            words = from->ptr;
+            words_cnt = from->size / sizeof(void *);
+        }
+        for (size_t k = 0; k < words_cnt; k++)
+        {
+            if ((from && !gc_layout_word(layout, from, k)) || !gc_in_heap(gc, words[k]))
+            {
+                continue;
+            }
+            gc_ptr_t *p = gc_get_item(gc, words[k]);
+            if (p == NULL || (p->flags & GC_MARK))
+            {
+                continue;
+            }
+            if (cnt == cap)
+            {
+                cap = cap ? cap * 2 : 1024;
+                gc_ptr_t **q = realloc(objs, cap * sizeof(gc_ptr_t *));
+                if (q == NULL)
+                {
+                    ret = -1;
+                    break;
+                }
+                objs = q;
+            }
+            p->flags |= GC_MARK;
+            objs[cnt++] = p;
+        }
+    }
+    if (ret == 0)
+    {
+        qsort(objs, cnt, sizeof(gc_ptr_t *), gc_cmp_item);
+        ret = gc_snapshot_write(path, objs, cnt, roots, roots_cnt, layout);
+    }
+    // turn the traced allocations back into unmarked
+    for (size_t i = 0; i < cnt; i++)
+    {
+        objs[i]->flags &= ~GC_MARK;
+    }
+    free(objs);
+    return ret;
+}
+
+/* find the index of the object at offset in table sorted by offset, cnt if absent */
+static uint64_t gc_image_find(gc_image_object_t *table, uint64_t cnt, uint64_t offset)
+{
+    uint64_t lo = 0, hi = cnt;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (table[mid].offset < offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo < cnt && table[lo].offset == offset) ? lo : cnt;
+}
+
+/* whether the size bytes at addr hold a heap image with roots_cnt roots
+ * that can be relocated and registered without corrupting the collector
+ * */
+static int gc_image_check(char *addr, size_t size, size_t roots_cnt)
+{
+    // the header first, the tables it locates must lie inside the file
+    gc_image_header_t *header = (gc_image_header_t *)addr;
+    if (memcmp(header->magic, GC_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->word_size != sizeof(void *) ||
+        header->roots_cnt != roots_cnt ||
+        header->objects_cnt >= size / sizeof(gc_image_object_t) ||
+        header->roots_cnt >= size / sizeof(uint64_t) ||
+        header->relocs_cnt >= size / sizeof(uint64_t) ||
+        sizeof(gc_image_header_t) + header->objects_cnt * sizeof(gc_image_object_t) +
+                (header->roots_cnt + header->relocs_cnt) * sizeof(uint64_t) > header->data_offset ||
+        header->data_offset % GC_IMAGE_ALIGN != 0 ||
+        header->data_offset > size || header->data_size > size - header->data_offset)
+    {
+        return 0;
+    }
+    gc_image_object_t *table = (gc_image_object_t *)(header + 1);
+    uint64_t *indexes = (uint64_t *)(table + header->objects_cnt);
+    uint64_t *relocs = indexes + header->roots_cnt;
+    char *data = addr + header->data_offset;
+    // objects aligned, in order and apart from each other, each with an address of its own
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < header->objects_cnt; i++)
+    {
+        if (table[i].offset % 16 != 0 || table[i].offset < end ||
+            table[i].offset >= header->data_size || table[i].size > header->data_size - table[i].offset ||
+            (table[i].flags & ~(uint64_t)(GC_ROOT | GC_LEAF)) != 0)
+        {
+            return 0;
+        }
+        end = table[i].offset + (table[i].size ? table[i].size : 1);
+    }
+    for (uint64_t i = 0; i < header->roots_cnt; i++)
+    {
+        if (indexes[i] >= header->objects_cnt && indexes[i] != GC_IMAGE_NONE)
+        {
+            return 0;
+        }
+    }
+    // pointer words in order, so none is relocated twice, each holding the offset of an object
+    for (uint64_t i = 0; i < header->relocs_cnt; i++)
+    {
+        if (relocs[i] % sizeof(void *) != 0 || header->data_size < sizeof(void *) ||
+            relocs[i] > header->data_size - sizeof(void *) || (i > 0 && relocs[i] <= relocs[i - 1]) ||
+            gc_image_find(table, header->objects_cnt, *(uintptr_t *)(data + relocs[i])) == header->objects_cnt)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* adopt the heap image file at path written by gc_snapshot
+ * the file is mapped and relocated in place, its objects are registered at once
+ * roots receive the relocated roots, roots_cnt must be the one given to gc_snapshot
+ * return 0 on success, -1 on failure
+ * */
+int gc_restore(gc_t *gc, const char *path, void **roots, size_t roots_cnt)
+{
+#ifdef GC_HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(gc_image_header_t))
+    {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    char *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return -1;
+    }
+    // check the image before touching it
+    gc_image_t *images = NULL;
+    if (gc_image_check(addr, size, roots_cnt))
+    {
+        images = realloc(gc->images, (gc->images_cnt + 1) * sizeof(gc_image_t));
+    }
+    if (images == NULL)
+    {
+        munmap(addr, size);
+        return -1;
+    }
+    gc_image_header_t *header = (gc_image_header_t *)addr;
+    gc_image_object_t *table = (gc_image_object_t *)(header + 1);
+    uint64_t *indexes = (uint64_t *)(table + header->objects_cnt);
+    uint64_t *relocs = indexes + header->roots_cnt;
+    char *data = addr + header->data_offset;
+    gc->images = images;
+    size_t image = gc->images_cnt++;
+    gc->images[image].addr = addr;
+    gc->images[image].size = size;
+    gc->images[image].live_cnt = header->objects_cnt;
+    // turn the data offsets back into pointers
+    for (uint64_t i = 0; i < header->relocs_cnt; i++)
+    {
+        *(uintptr_t *)(data + relocs[i]) += (uintptr_t)data;
+    }
+    // register the objects, the slots are resized only once
+    if (header->objects_cnt > 0)
+    {
+        gc->items_cnt1 += header->objects_cnt;
+        gc_adjust_slots(gc);
+        for (uint64_t i = 0; i < header->objects_cnt; i++)
+        {
+            gc_ptr_t *p = gc_insert_item(gc, data + table[i].offset, table[i].size,
+                                         (int)table[i].flags, NULL);
+            p->node = GC_HEAP_IMAGE(image);
+        }
+        gc->items_cnt2 = gc->items_cnt1 + (size_t)(gc->items_cnt1 * gc->sweep_factor) + 1;
+    }
+    for (size_t i = 0; i < roots_cnt; i++)
+    {
+        roots[i] = indexes[i] == GC_IMAGE_NONE ? NULL : data + table[indexes[i]].offset;
+    }
+    if (header->objects_cnt == 0) // nothing inside to keep it mapped for
+    {
+        munmap(addr, size);
+        gc->images[image].addr = NULL;
+        gc->images[image].size = 0;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -13,18 +13,68 @@ enum flag{
   GC_LEAF = 0x04
 };
 
+#define GC_PROFILE_DEPTH 32   // max frames recorded for a sampled allocation
+#define GC_MAX_NODES 8        // max numa nodes served by the region heap
+#define GC_CLASSES_COUNT 8    // size classes of the region heap, 16 bytes to 2048 bytes
+#define GC_CHUNK_PAGES 512    // 4 KiB pages of one 2 MiB chunk of the blacklist
+
+typedef struct gc_site{
+  void *frames[GC_PROFILE_DEPTH]; // return addresses of the call stack
+  int depth;                      // number of valid frames
+  size_t hash;                    // hash value of the frames
+  size_t alloc_cnt;               // number of sampled allocations from this call site
+  size_t alloc_bytes;             // bytes of sampled allocations from this call site
+  size_t live_cnt;                // number of sampled allocations not freed yet
+  size_t live_bytes;              // bytes of sampled allocations not freed yet
+}gc_site_t;
+
 typedef struct gc_ptr{
   void *ptr;    // ptr to the allocation
   int flags;    // indicate that the allocation is a GC_ROOT or GC_LEAF or NULL
   size_t size;  // size of allocation
-  size_t hash;  // store the hash value(the location of the slot where it should be at start)
+  size_t hash;  // store the hash value(the location of the slot where it should be at start, plus 1)
   void (*dtor)(void*);  // destructor function
+  size_t site;          // index+1 of the call site in gc->sites if sampled, 0 otherwise
+  int node;             // numa node of the region holding the allocation, -1 if from malloc, -2-i if inside heap image i
 }gc_ptr_t;
 
+typedef struct gc_node{
+  char *cur;                      // bump pointer in the current region of this node
+  char *end;                      // end of the current region of this node
+  void *free[GC_CLASSES_COUNT];   // released blocks of each size class
+}gc_node_t;
+
+typedef struct gc_stats{
+  size_t node_allocs[GC_MAX_NODES]; // allocations placed on each numa node
+  size_t node_bytes[GC_MAX_NODES];  // live bytes placed on each numa node
+  size_t heap_hits;                 // allocations served by a region of the caller's node
+  size_t heap_misses;               // allocations falling back to malloc with heap on
+  size_t regions_cnt;               // regions reserved
+  size_t regions_huge;              // regions advised to be backed by huge pages
+  size_t regions_local;             // regions whose first page landed on the requested node
+  size_t false_hits;                // scanned words in heap range outside every live allocation
+  size_t blacklisted;               // blocks held back since their address was blacklisted
+  size_t held_bytes;                // bytes of the blocks currently held back
+}gc_stats_t;
+
+typedef struct gc_chunk{
+  uintptr_t key;                            // chunk number of the address space plus 1, 0 if the slot is empty
+  uint64_t pages[2][GC_CHUNK_PAGES / 64];   // bitmaps of the pages hit by false pointers, new then old
+}gc_chunk_t;
+
+typedef struct gc_image{
+  void *addr;       // address where the heap image file is mapped, NULL once unmapped
+  size_t size;      // size of the mapping
+  size_t live_cnt;  // objects of the image not yet released, unmapped when it drops to 0
+}gc_image_t;
+
+// pointer map given to gc_snapshot: nonzero if word index word of allocation ptr of size bytes holds a pointer
+typedef int (*gc_layout_t)(void *ptr, size_t size, size_t word);
+
 typedef struct gc{
   void *bottom;               // stack bottom
   int paused;                 // paused or resume the garbage collector
-  uintptr_t min_ptr, max_ptr; // range of heap(min_ptr:lowest address max_ptr:highest address)
+  uintptr_t min_ptr, max_ptr; // range of allocations from malloc(min_ptr:lowest address max_ptr:highest address)
  
   double sweep_factor;        // factor controls the threshold
   size_t items_cnt2;          // threshold of items number controls automatically sweeping
@@ -36,11 +86,51 @@ typedef struct gc{
 
   size_t frees_cnt;           // number of allocation(unmarked) waiting to be freed
   gc_ptr_t *frees;            // allocations needed be freed 
+
+  int profiling;              // whether the sampling allocation profiler is on
+  size_t prof_rate;           // average bytes allocated between two samples
+  size_t prof_left;           // bytes left to allocate until the next sample
+  uint64_t prof_seed;         // state of the generator jittering sample intervals
+  uintptr_t prof_entry;       // stack address inside the collector call being made
+  gc_site_t *sites;           // table list of sampled call sites
+  size_t sites_cnt;           // number of call sites in sites
+  size_t sites_cap;           // capacity of sites
+  size_t *sites_index;        // hashtable of index+1 into sites by call stack, 0 if empty
+  size_t index_cnt;           // number of slots in sites_index, a power of 2
+
+  int precise;                // scan only registered local slots instead of the whole stack
+  void ***roots;              // shadow stack of the addresses of registered local variables
+  size_t roots_cnt;           // number of registered slots in roots
+  size_t roots_cap;           // capacity of roots
+  size_t *scopes;             // roots_cnt at the entry of each open handle scope
+  size_t scopes_cnt;          // number of open handle scopes
+  size_t scopes_cap;          // capacity of scopes
+
+  int heap;                   // whether small allocations are placed in numa regions
+  gc_node_t nodes[GC_MAX_NODES]; // allocation state of each numa node
+  void **regions;             // base addresses of reserved regions, sorted
+  size_t regions_cap;         // capacity of regions
+  gc_stats_t stats;           // placement statistics
+
+  gc_image_t *images;         // heap images adopted by gc_restore
+  size_t images_cnt;          // number of heap images
+
+  int blacklisting;           // whether addresses hit by false pointers are avoided
+  gc_chunk_t *chunks;         // hashtable of the blacklisted pages by chunk
+  size_t chunks_cnt;          // number of chunks in chunks
+  size_t chunks_slots;        // number of slots in chunks, a power of 2
+  uintptr_t *misses;          // scanned words in heap range missing every allocation during marking
+  size_t misses_cnt;          // number of words in misses
+  size_t misses_cap;          // capacity of misses
+  gc_ptr_t *held;             // blacklisted blocks kept from being handed out
+  size_t held_cnt;            // number of held blocks
+  size_t held_cap;            // capacity of held
 }gc_t;
 
 
 
 void gc_start(gc_t *gc, void *stk);
+void gc_start_precise(gc_t *gc);
 void gc_stop(gc_t *gc);
 
 void gc_sweep(gc_t *gc);
@@ -62,4 +152,21 @@ void gc_set_dtor(gc_t *gc, void *ptr, void (*dtor)(void *));
 void (*gc_get_dtor(gc_t *gc, void *ptr))(void *);
 size_t gc_get_size(gc_t *gc, void *ptr);
 
+int gc_scope_enter(gc_t *gc);
+void gc_scope_leave(gc_t *gc);
+int gc_root_local(gc_t *gc, void *slot);
+
+// gc_t has no locking: placement follows the numa node of the one thread
+// allocating through it, and only migrations of that thread between nodes
+int gc_heap_start(gc_t *gc);
+void gc_get_stats(gc_t *gc, gc_stats_t *stats);
+void gc_blacklist_start(gc_t *gc);
+
+int gc_snapshot(gc_t *gc, const char *path, void **roots, size_t roots_cnt, gc_layout_t layout);
+int gc_restore(gc_t *gc, const char *path, void **roots, size_t roots_cnt);
+
+void gc_profile_start(gc_t *gc, size_t rate);
+void gc_profile_stop(gc_t *gc);
+int gc_profile_dump(gc_t *gc, FILE *fp);
+
 #endif
\ No newline at end of file
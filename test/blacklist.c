@@ -0,0 +1,61 @@
+#include "gc.h"
+#include <assert.h>
+
+#define PAGE(p) ((uintptr_t)(p) >> 12)
+
+static gc_t gc;
+
+int main(int argc, char **argv)
+{
+    // no stack scanning, only registered slots are roots
+    gc_start_precise(&gc);
+    if (gc_heap_start(&gc) != 0) // regions not supported, nothing to check
+    {
+        gc_stop(&gc);
+        return 0;
+    }
+    gc_blacklist_start(&gc);
+    gc_pause(&gc);
+    gc_stats_t st;
+
+    // interior and end pointers into a live allocation are not false pointers
+    char *keep = gc_alloc(&gc, 48);    // in a block of 64 bytes, so nothing starts at its end
+    uintptr_t inner = (uintptr_t)keep + 8, end = (uintptr_t)keep + 48;
+    assert(gc_root_local(&gc, &keep) == 0);
+    assert(gc_root_local(&gc, &inner) == 0);
+    assert(gc_root_local(&gc, &end) == 0);
+    gc_run(&gc);
+    gc_get_stats(&gc, &st);
+    assert(st.false_hits == 0);
+
+    // a word left pointing to a released block blacklists its page
+    void *obj = gc_alloc(&gc, 64);
+    uintptr_t fake = (uintptr_t)obj;
+    assert(gc_root_local(&gc, &fake) == 0);
+    gc_free(&gc, obj);
+    gc_run(&gc);
+    gc_get_stats(&gc, &st);
+    assert(st.false_hits == 1);
+
+    // the released block is held, and the new one comes from another page
+    void *next = gc_alloc(&gc, 64);
+    gc_get_stats(&gc, &st);
+    assert(PAGE(next) != PAGE(fake));
+    assert(st.blacklisted == 1 && st.held_bytes == 64);
+    assert(st.heap_hits + st.heap_misses == 3); // the held block isn't counted
+
+    // held blocks are released once their page leaves the blacklist,
+    // even if no allocation is left to sweep by then
+    keep = NULL;
+    inner = end = fake = 0;
+    gc_run(&gc);
+    assert(gc.items_cnt1 == 0);
+    gc_get_stats(&gc, &st);
+    assert(st.held_bytes == 64);
+    gc_run(&gc);
+    gc_get_stats(&gc, &st);
+    assert(st.held_bytes == 0 && gc.held_cnt == 0);
+
+    gc_stop(&gc);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "gc.h"
+#include <assert.h>
+
+static gc_t gc;
+
+/* live bytes placed on all numa nodes */
+static size_t node_bytes(void)
+{
+    gc_stats_t st;
+    gc_get_stats(&gc, &st);
+    size_t sum = 0;
+    for (int i = 0; i < GC_MAX_NODES; i++)
+    {
+        sum += st.node_bytes[i];
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    gc_start_precise(&gc);
+    if (gc_heap_start(&gc) != 0) // regions not supported, nothing to check
+    {
+        gc_stop(&gc);
+        return 0;
+    }
+    gc_pause(&gc);
+    gc_stats_t st;
+
+    char *a = gc_alloc(&gc, 16);
+    char *b = gc_alloc(&gc, 100);   // size class of 128 bytes
+    gc_get_stats(&gc, &st);
+    assert(st.regions_cnt >= 1);
+    assert(st.heap_hits == 2 && st.heap_misses == 0);
+    assert(node_bytes() == 116);
+
+    // within its size class the allocation stays in place
+    assert(gc_realloc(&gc, a, 12) == a);
+    assert(gc_get_size(&gc, a) == 12 && node_bytes() == 112);
+
+    // across size classes, then out to malloc, the contents move along
+    for (int i = 0; i < 100; i++)
+    {
+        b[i] = (char)i;
+    }
+    b = gc_realloc(&gc, b, 1000);
+    assert(b != NULL && gc_get_size(&gc, b) == 1000);
+    b = gc_realloc(&gc, b, 10000);
+    assert(b != NULL && gc_get_size(&gc, b) == 10000);
+    for (int i = 0; i < 100; i++)
+    {
+        assert(b[i] == (char)i);
+    }
+    gc_get_stats(&gc, &st);
+    assert(st.heap_hits == 3 && st.heap_misses == 1);
+    assert(node_bytes() == 12);
+
+    // a block reused from the free list of its size class comes back zeroed by calloc
+    char *c = gc_alloc(&gc, 64);
+    memset(c, 0xff, 64);
+    gc_free(&gc, c);
+    char *d = gc_calloc(&gc, 1, 64);
+    assert(d == c);
+    for (int i = 0; i < 64; i++)
+    {
+        assert(d[i] == 0);
+    }
+
+    gc_free(&gc, a);
+    gc_free(&gc, b);
+    gc_free(&gc, d);
+    assert(gc.items_cnt1 == 0 && node_bytes() == 0);
+    gc_stop(&gc);
+    return 0;
+}
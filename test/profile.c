@@ -0,0 +1,73 @@
+#include "gc.h"
+#include <assert.h>
+
+#define COUNT 2000
+
+static gc_t gc;
+static void *ptrs[COUNT];
+
+/* the call site every sample should be attributed to
+ * it stores the result itself, so the call can't become a tail call
+ * */
+__attribute__((noinline)) static void alloc_site(int i, size_t size)
+{
+    ptrs[i] = gc_alloc(&gc, size);
+}
+
+/* parse a dump, check its format and return the header totals */
+static void check_dump(FILE *fp, size_t total[4])
+{
+    size_t sum[4] = {0, 0, 0, 0};
+    size_t rate;
+    rewind(fp);
+    assert(fscanf(fp, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                  &total[0], &total[1], &total[2], &total[3], &rate) == 5);
+    assert(rate == 4096);
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) && line[0] != '\n')
+    {
+        size_t n[4];
+        int off = 0;
+        assert(sscanf(line, "%zu: %zu [%zu: %zu] @%n", &n[0], &n[1], &n[2], &n[3], &off) == 4 && off > 0);
+        // the leaf frame returns into alloc_site, not into the collector
+        void *leaf = NULL;
+        assert(sscanf(line + off, " %p", &leaf) == 1);
+        assert((uintptr_t)leaf > (uintptr_t)alloc_site && (uintptr_t)leaf < (uintptr_t)alloc_site + 256);
+        for (int k = 0; k < 4; k++)
+        {
+            sum[k] += n[k];
+        }
+    }
+    assert(memcmp(sum, total, sizeof(sum)) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    gc_start(&gc, &argc);
+    gc_pause(&gc);
+    gc_profile_start(&gc, 4096);
+    for (int i = 0; i < COUNT; i++)
+    {
+        alloc_site(i, 64 + i % 256);
+    }
+    FILE *fp = tmpfile();
+    size_t total[4];
+    assert(gc_profile_dump(&gc, fp) == 0);
+    check_dump(fp, total);
+    assert(total[2] > 0 && total[0] == total[2] && total[1] == total[3]);
+    // freed samples are no longer live but stay allocated
+    for (int i = 0; i < COUNT; i++)
+    {
+        gc_free(&gc, ptrs[i]);
+    }
+    fclose(fp);
+    fp = tmpfile();
+    size_t after[4];
+    assert(gc_profile_dump(&gc, fp) == 0);
+    check_dump(fp, after);
+    assert(after[0] == 0 && after[1] == 0 && after[2] == total[2] && after[3] == total[3]);
+    fclose(fp);
+    gc_profile_stop(&gc);
+    gc_stop(&gc);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "gc.h"
+#include <assert.h>
+
+static gc_t gc;
+static int freed;
+
+static void count_free(void *ptr)
+{
+    freed++;
+}
+
+int main(int argc, char **argv)
+{
+    // no stack scanning, only registered slots are roots
+    gc_start_precise(&gc);
+    gc_pause(&gc);
+
+    void *kept = NULL, *inner = NULL;
+    assert(gc_scope_enter(&gc) == 0);
+    assert(gc_root_local(&gc, &kept) == 0);
+    kept = gc_alloc_opt(&gc, 2 * sizeof(void *), 0, count_free);
+    ((void **)kept)[0] = gc_alloc_opt(&gc, 16, 0, count_free);    // reachable from kept
+    ((void **)kept)[1] = NULL;
+
+    assert(gc_scope_enter(&gc) == 0);
+    assert(gc_root_local(&gc, &inner) == 0);
+    inner = gc_alloc_opt(&gc, 16, 0, count_free);
+    void *unrooted = gc_alloc_opt(&gc, 16, 0, count_free);        // on the stack but never registered
+    gc_run(&gc);
+    assert(freed == 1);
+    assert(gc_get_size(&gc, unrooted) == 0);
+    assert(gc_get_size(&gc, inner) == 16);
+
+    // leaving the scope unregisters inner
+    gc_scope_leave(&gc);
+    gc_run(&gc);
+    assert(freed == 2);
+    assert(gc_get_size(&gc, kept) == 2 * sizeof(void *));
+    assert(gc_get_size(&gc, ((void **)kept)[0]) == 16);
+
+    gc_scope_leave(&gc);
+    gc_run(&gc);
+    assert(freed == 4);
+    assert(gc.items_cnt1 == 0);
+    gc_stop(&gc);
+    return 0;
+}
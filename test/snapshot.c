@@ -0,0 +1,146 @@
+#include "gc.h"
+#include <assert.h>
+
+typedef struct node{
+    struct node *next;  // the only pointer word of a node
+    uintptr_t value;    // an integer, may equal the address of another node
+    char *name;         // not described by the layout, so never relocated
+}node;
+
+static gc_t gc, gc2, gc3;
+
+static int node_layout(void *ptr, size_t size, size_t word)
+{
+    return word == 0;
+}
+
+/* copy file src to dst cut to len bytes, a negative len keeps all of it */
+static void copy_image(const char *src, const char *dst, long len)
+{
+    FILE *in = fopen(src, "rb"), *out = fopen(dst, "wb");
+    assert(in != NULL && out != NULL);
+    int c;
+    for (long i = 0; (c = fgetc(in)) != EOF && (len < 0 || i < len); i++)
+    {
+        fputc(c, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+/* read the 64 bits word at offset of file path */
+static uint64_t read_word(const char *path, long offset)
+{
+    uint64_t w = 0;
+    FILE *fp = fopen(path, "rb");
+    assert(fp != NULL && fseek(fp, offset, SEEK_SET) == 0 && fread(&w, sizeof(w), 1, fp) == 1);
+    fclose(fp);
+    return w;
+}
+
+/* copy image src to dst with the 64 bits word at offset replaced by w */
+static void patch_image(const char *src, const char *dst, long offset, uint64_t w)
+{
+    copy_image(src, dst, -1);
+    FILE *fp = fopen(dst, "r+b");
+    assert(fp != NULL && fseek(fp, offset, SEEK_SET) == 0 && fwrite(&w, sizeof(w), 1, fp) == 1);
+    fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = "bin/snapshot.img";
+    const char *bad = "bin/snapshot.bad";
+
+    // a list of 3 nodes, each value holding the address of the node before it
+    gc_start_precise(&gc);
+    gc_pause(&gc);
+    node *head = NULL;
+    assert(gc_root_local(&gc, &head) == 0);
+    for (int i = 0; i < 3; i++)
+    {
+        node *n = gc_alloc(&gc, sizeof(node));
+        n->next = head;
+        n->value = (uintptr_t)head;
+        n->name = NULL;
+        head = n;
+    }
+    node *addrs[3] = {head, head->next, head->next->next};
+    gc_alloc(&gc, 64);  // unreachable, left out of the image
+    void *roots[2] = {head, NULL};
+    assert(gc_snapshot(&gc, path, roots, 2, node_layout) == 0);
+
+    // round trip
+    gc_start_precise(&gc2);
+    gc_pause(&gc2);
+    void *back[2];
+    assert(gc_restore(&gc2, path, back, 2) == 0);
+    assert(gc2.items_cnt1 == 3);
+    assert(back[1] == NULL);
+    node *copy = back[0];
+    assert(gc_root_local(&gc2, &copy) == 0);
+    node *p = copy;
+    for (int i = 0; i < 3; i++, p = p->next)
+    {
+        assert(gc_get_size(&gc2, p) == sizeof(node));
+        assert(p->value == (uintptr_t)(i < 2 ? addrs[i + 1] : NULL));  // integers stay untouched
+    }
+    assert(p == NULL);
+
+    // the image is unmapped once its last object is swept
+    assert(gc2.images_cnt == 1 && gc2.images[0].addr != NULL);
+    copy = NULL;
+    gc_run(&gc2);
+    assert(gc2.items_cnt1 == 0);
+    assert(gc2.images[0].addr == NULL);
+    gc_stop(&gc2);
+
+    // corrupted or truncated images are rejected before being adopted
+    // the header is 7 words, then 3 objects of 3 words, 2 root indexes and 2 relocations
+    long table = 7 * 8, relocs = table + 3 * 24 + 2 * 8;
+    uint64_t data = read_word(path, 5 * 8);
+    gc_start_precise(&gc3);
+    patch_image(path, bad, 0, 0);                   // magic
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    patch_image(path, bad, 8, 4);                   // word size
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    copy_image(path, bad, 16);                      // header cut short
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    assert(gc_restore(&gc3, path, back, 1) == -1);  // roots count differs
+    patch_image(path, bad, table + 24, 8);          // object misaligned
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    patch_image(path, bad, table + 24, 0);          // objects overlapping
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    patch_image(path, bad, relocs + 8, read_word(path, relocs)); // pointer word relocated twice
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    patch_image(path, bad, data + read_word(path, relocs), 8);   // pointing inside an object
+    assert(gc_restore(&gc3, bad, back, 2) == -1);
+    assert(gc3.items_cnt1 == 0 && gc3.images_cnt == 0);
+    gc_stop(&gc3);
+
+    // an empty object still gets an address of its own
+    void **pair = gc_alloc(&gc, 2 * sizeof(void *));
+    pair[0] = gc_alloc(&gc, 0);
+    pair[1] = gc_alloc(&gc, 32);
+    roots[0] = pair;
+    assert(gc_snapshot(&gc, path, roots, 2, NULL) == 0);
+    gc_start_precise(&gc2);
+    gc_pause(&gc2);
+    assert(gc_restore(&gc2, path, back, 2) == 0);
+    pair = back[0];
+    assert(gc2.items_cnt1 == 3 && pair[0] != pair[1]);
+    assert(gc_get_size(&gc2, pair[0]) == 0 && gc_get_size(&gc2, pair[1]) == 32);
+    gc_run(&gc2);
+    assert(gc2.items_cnt1 == 0 && gc2.images[0].addr == NULL);
+    gc_stop(&gc2);
+
+    // with a layout, a pointer word which can't be relocated fails the snapshot
+    head->next = (node *)((char *)head->next + 8);
+    roots[0] = head;
+    assert(gc_snapshot(&gc, path, roots, 2, node_layout) == -1);
+
+    gc_stop(&gc);
+    remove(path);
+    remove(bad);
+    return 0;
+}